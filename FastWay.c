@@ -19,8 +19,13 @@
 
 #include <stdint.h>
 
+#include <pthread.h>
+
+#include <unistd.h>
+
 typedef struct Station {
     int distance;
+    int dead; //demolished with --tombstones, kept until revived or compacted
     struct Car * carHead;
     struct Station * left;
     struct Station * right;
@@ -35,9 +40,127 @@ typedef struct Car {
 }
 Car;
 
+typedef struct Subscription {
+    int start;
+    int end;
+    int active; //both stations exist and the labelling is valid
+    int size;
+    int capacity;
+    int * distance; //stations of the corridor in travel order
+    int * range; //largest range of each station, 0 if it has no cars
+    int * jumps; //hop label, INT32_MAX if unreachable
+    int * parent; //how many stations back the previous stop is, 0 if none
+    int routeLength; //0 means no route
+    int * route;
+    struct Subscription * next;
+}
+Subscription;
+
+typedef struct Block {
+    int first; //distance of the first station
+    int count;
+    int bytes;
+    int fleetSize;
+    int * range; //largest range of each station, 0 if it has no cars
+    unsigned char * gaps; //varint distances from the previous station
+    int * fleets; //for each station its number of cars, then their ranges from the largest
+}
+Block;
+
+typedef struct BlockCursor {
+    int block;
+    int index;
+    int offset; //of the next gap
+    int distance;
+}
+BlockCursor;
+
+typedef enum {
+    NO_MUTATION,
+    RANGE_CHANGED,
+    STATION_ADDED,
+    STATION_DELETED
+}
+MutationKind;
+
+typedef struct Shard {
+    Station * root;
+    int live;
+    int dead;
+}
+Shard;
+
+typedef enum {
+    ADD_STATION,
+    DELETE_STATION,
+    ADD_CAR,
+    DELETE_CAR
+}
+CommandKind;
+
+typedef struct Command {
+    CommandKind kind;
+    int distance;
+    int count;
+    int * values; //ranges of the cars to add or scrap
+    char * response;
+    MutationKind mutation;
+    int range;
+}
+Command;
+
 FILE * file;
-int boolean = 0;
+_Thread_local int boolean = 0; //per thread, mutations may run on several shards at once
 Station * root;
+Subscription * subscriptions;
+
+//tombstoned demolition, enabled with --tombstones
+#ifndef COMPACTION_MIN_DEAD
+#define COMPACTION_MIN_DEAD 64
+#endif
+int tombstones = 0;
+int liveStations;
+int deadStations;
+
+//block storage, enabled with --blocks
+#ifndef BLOCK_SIZE
+#define BLOCK_SIZE 128
+#endif
+int blockStorage = 0;
+Block * blocks;
+int blockCount;
+int blockCapacity;
+
+//range sharding, enabled with --shards
+#ifndef MAX_BATCH
+#define MAX_BATCH 65536
+#endif
+#ifndef MIN_PARALLEL_BATCH
+#define MIN_PARALLEL_BATCH 256
+#endif
+#ifndef MAX_THREADS
+#define MAX_THREADS 64
+#endif
+Shard * shards;
+int shardCount = 0;
+int shardWidth = 1000;
+int threadCount = 0;
+int startedThreads = 1; //the main thread is worker 0
+Command * batch;
+int batchSize;
+int * batchOrder; //indexes of the batch grouped by worker
+int workerStart[MAX_THREADS + 1];
+int workerEnd[MAX_THREADS];
+pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+int poolRound;
+int poolPending;
+
+//last mutation applied, read by updateSubscriptions
+MutationKind lastMutation = NO_MUTATION;
+int mutatedDistance;
+int mutatedRange;
 
 /**
  * Searches for a station with a specific distance.
@@ -58,6 +181,55 @@ Station * searchStation(Station * station, int number) {
         return searchStation(station -> left, number);
 }
 
+/**
+ * Searches for a station with a specific distance that has not been demolished.
+ *
+ * @param station The root station to start the search from.
+ * @param number  The distance of the station to search for.
+ * @return        Pointer to the found station, or NULL if not found or dead.
+ */
+Station * searchLiveStation(Station * station, int number) {
+    station = searchStation(station, number);
+    if (station == NULL || station -> dead)
+        return NULL;
+    return station;
+}
+
+/**
+ * Returns the shard owning a distance.
+ *
+ * @param number  The distance.
+ * @return        The index of the shard, the last one for distances beyond the others.
+ */
+int shardOf(int number) {
+    int shard = number / shardWidth;
+    return shard < shardCount ? shard : shardCount - 1;
+}
+
+/**
+ * Searches for a station with a specific distance in the whole network.
+ *
+ * @param number  The distance of the station to search for.
+ * @return        Pointer to the found station, or NULL if not found.
+ */
+Station * findStation(int number) {
+    if (shardCount != 0)
+        return searchLiveStation(shards[shardOf(number)].root, number);
+    return searchLiveStation(root, number);
+}
+
+/**
+ * Returns the largest range available at a station.
+ *
+ * @param station The station to inspect.
+ * @return        The range of the first car, or 0 if the station has no cars.
+ */
+int maxRange(Station * station) {
+    if (station -> carHead == NULL)
+        return 0;
+    return station -> carHead -> range;
+}
+
 /**
  * Removes a car with a specific range from a station.
  *
@@ -102,7 +274,7 @@ char * deleteCarSupport() {
     fscanf(file, "%d", & num);
 
     //I look for the station and if it is NULL I stop reading the line of the file and exit
-    Station * station = searchStation(root, num);
+    Station * station = searchLiveStation(root, num);
     if (station == NULL || station -> carHead == NULL) {
         fscanf(file, "%d", &useless);
         return "non rottamata";
@@ -114,8 +286,11 @@ char * deleteCarSupport() {
     deleteCar(station, num);
     if (boolean == 0)
         return "non rottamata";
-    else
-        return "rottamata";
+
+    lastMutation = RANGE_CHANGED;
+    mutatedDistance = station -> distance;
+    mutatedRange = maxRange(station);
+    return "rottamata";
 }
 
 /**
@@ -158,7 +333,7 @@ void addCar(Station * station, int number) {
 char * addCarSupport() {
     int num;
     fscanf(file, "%d", & num);
-    Station * station = searchStation(root, num);
+    Station * station = searchLiveStation(root, num);
 
     //case the station does not exist
     if (station == NULL) {
@@ -169,6 +344,10 @@ char * addCarSupport() {
     //add the station 
     fscanf(file, "%d", & num);
     addCar(station, num);
+
+    lastMutation = RANGE_CHANGED;
+    mutatedDistance = station -> distance;
+    mutatedRange = maxRange(station);
     return "aggiunta";
 }
 
@@ -180,6 +359,7 @@ char * addCarSupport() {
 Station * createStation(int number) {
     Station * newStation = (Station * ) malloc(sizeof(Station));
     newStation -> distance = number;
+    newStation -> dead = 0;
     newStation -> right = NULL;
     newStation -> left = NULL;
     newStation -> carHead = NULL;
@@ -206,6 +386,33 @@ Station * addStationRecursively(Station * current, int number) {
     return current;
 }
 
+/**
+ * Removes all cars from a linked list of cars.
+ *
+ * @param current The head of the linked list of cars to be removed.
+ */
+void removeCarsList(Car * current) {
+    Car * supp = current;
+    while (supp != NULL) {
+        supp = current -> next;
+        free(current);
+        current = supp;
+    }
+}
+
+/**
+ * Revives a demolished station in place, releasing the fleet it kept.
+ *
+ * @param station The dead station.
+ * @param dead    The number of dead stations of its tree, decremented.
+ */
+void reviveStation(Station * station, int * dead) {
+    removeCarsList(station -> carHead);
+    station -> carHead = NULL;
+    station -> dead = 0;
+    ( * dead)--;
+}
+
 /**
  * Adds a new station to the system based on user input.
  *
@@ -217,8 +424,12 @@ char * addStation() {
     fscanf(file, "%d", & num);
 
     boolean = 0;
-    //check if root exists
-    if (root == NULL) {
+    Station * tomb = tombstones ? searchStation(root, num) : NULL;
+    //a demolished station comes back in its old slot
+    if (tomb != NULL && tomb -> dead) {
+        reviveStation(tomb, & deadStations);
+        boolean = 1;
+    } else if (root == NULL) { //check if root exists
         root = createStation(num);
         boolean = 1;
     } else {
@@ -232,6 +443,8 @@ char * addStation() {
         return "non aggiunta";
     }
 
+    if (tombstones)
+        liveStations++;
     Station * newStation = searchStation(root, num);
     fscanf(file, "%d", &num);
 
@@ -243,23 +456,12 @@ char * addStation() {
         addCar(newStation, num2);
     }
 
+    lastMutation = STATION_ADDED;
+    mutatedDistance = newStation -> distance;
+    mutatedRange = maxRange(newStation);
     return "aggiunta";
 }
 
-/**
- * Removes all cars from a linked list of cars.
- *
- * @param current The head of the linked list of cars to be removed.
- */
-void removeCarsList(Car * current) {
-    Car * supp = current;
-    while (supp != NULL) {
-        supp = current -> next;
-        free(current);
-        current = supp;
-    }
-}
-
 /**
  * Frees the memory of a station and its associated cars.
  *
@@ -408,6 +610,77 @@ void deleteRootStation(int number) {
     root -> right = deleteNoCarStation(root -> right, supp -> distance);
 }
 
+/**
+ * Collects the live stations of a tree in order, freeing the dead ones and their fleets.
+ *
+ * @param current The current station being considered during the visit.
+ * @param live    Array receiving the live stations.
+ * @param count   The number of stations collected so far.
+ */
+void collectLiveStations(Station * current, Station ** live, int * count) {
+    if (current == NULL)
+        return;
+
+    collectLiveStations(current -> left, live, count);
+    Station * right = current -> right;
+    if (current -> dead)
+        freeStation(current);
+    else
+        live[( * count)++] = current;
+    collectLiveStations(right, live, count);
+}
+
+/**
+ * Links sorted stations into a balanced binary search tree.
+ *
+ * @param live  The sorted stations.
+ * @param low   The index of the first station of the subtree.
+ * @param high  The index after the last station of the subtree.
+ * @return      The root of the subtree.
+ */
+Station * buildBalancedTree(Station ** live, int low, int high) {
+    if (low >= high)
+        return NULL;
+
+    int middle = (low + high) / 2;
+    Station * station = live[middle];
+    station -> left = buildBalancedTree(live, low, middle);
+    station -> right = buildBalancedTree(live, middle + 1, high);
+    return station;
+}
+
+/**
+ * Demolishes a station by marking it dead; its fleet is released only when the slot is
+ * revived or compacted away. Once dead stations are at least as many as the live ones,
+ * the tree is rebuilt balanced with the live stations only.
+ *
+ * @param current The root of the tree.
+ * @param number  The distance of the station to demolish.
+ * @param live    The number of live stations of the tree.
+ * @param dead    The number of dead stations of the tree.
+ * @return        The root of the updated tree.
+ */
+Station * buryStation(Station * current, int number, int * live, int * dead) {
+    Station * station = searchLiveStation(current, number);
+    if (station == NULL)
+        return current;
+
+    boolean = 1;
+    station -> dead = 1;
+    ( * live)--;
+    ( * dead)++;
+    if ( * dead < COMPACTION_MIN_DEAD || * dead < * live)
+        return current;
+
+    Station ** stations = (Station ** ) malloc(sizeof(Station * ) * ( * live + 1));
+    int count = 0;
+    collectLiveStations(current, stations, & count);
+    current = buildBalancedTree(stations, 0, count);
+    free(stations);
+    * dead = 0;
+    return current;
+}
+
 /**
  * Adds a new station to the system based on user input.
  *
@@ -417,6 +690,16 @@ char * deleteStationSupport() {
     int num;
     fscanf(file, "%d", & num);
 
+    if (tombstones) {
+        boolean = 0;
+        root = buryStation(root, num, & liveStations, & deadStations);
+        if (boolean == 0)
+            return "non demolita";
+        lastMutation = STATION_DELETED;
+        mutatedDistance = num;
+        return "demolita";
+    }
+
     //if no stations exist
     if (root == NULL)
         return "non demolita";
@@ -424,6 +707,8 @@ char * deleteStationSupport() {
     //if the station to delete is the root
     if (root -> distance == num) {
         deleteRootStation(num);
+        lastMutation = STATION_DELETED;
+        mutatedDistance = num;
         return "demolita";
     }
 
@@ -433,50 +718,106 @@ char * deleteStationSupport() {
     if (boolean == 0)
         return "non demolita";
     else {
+        lastMutation = STATION_DELETED;
+        mutatedDistance = num;
         return "demolita";
     }
 }
 
+/**
+ * Searches for the next station with a greater distance from a given number in a tree.
+ *
+ * @param current The root of the tree.
+ * @param number  The distance of the current station.
+ * @return        Pointer to the next station with greater distance, or NULL.
+ */
+Station * successorStation(Station * current, int number) {
+    Station * best;
+
+    //tombstones are skipped
+    do {
+        Station * station = current;
+        best = NULL;
+        while (station != NULL) {
+            if (station -> distance > number) {
+                best = station;
+                station = station -> left;
+            } else {
+                station = station -> right;
+            }
+        }
+        if (best != NULL)
+            number = best -> distance;
+    } while (best != NULL && best -> dead);
+    return best;
+}
+
 /**
  * Searches for the next station with a greater distance from a given number.
+ * With shards, the search moves on to the following shards when the current one has no
+ * greater station, so routes are stitched across shard boundaries.
  *
  * @param number  The distance of the current station.
  * @return        Pointer to the next station with greater distance.
  */
 Station * nextStation(int number) {
-    Station * best = NULL;
-    Station * current = root;
+    if (shardCount == 0)
+        return successorStation(root, number);
 
-    while (current != NULL) {
-        if (current -> distance > number) {
-            best = current;
-            current = current -> left;
-        } else {
-            current = current -> right;
-        }
+    for (int i = shardOf(number); i < shardCount; i++) {
+        Station * best = successorStation(shards[i].root, number);
+        if (best != NULL)
+            return best;
     }
+    return NULL;
+}
+
+/**
+ * Searches for the previous station with a smaller distance from a given number in a tree.
+ *
+ * @param current The root of the tree.
+ * @param number  The distance of the current station.
+ * @return        Pointer to the previous station with smaller distance, or NULL.
+ */
+Station * predecessorStation(Station * current, int number) {
+    Station * best;
+
+    //tombstones are skipped
+    do {
+        Station * station = current;
+        best = NULL;
+        while (station != NULL) {
+            if (station -> distance < number) {
+                best = station;
+                station = station -> right;
+            } else {
+                station = station -> left;
+            }
+        }
+        if (best != NULL)
+            number = best -> distance;
+    } while (best != NULL && best -> dead);
     return best;
 }
 
 /**
  * Searches for the previous station with a smaller distance from a given number.
+ * With shards, the search moves back to the preceding shards when the current one has no
+ * smaller station.
  *
  * @param number  The distance of the current station.
  * @return        Pointer to the previous station with smaller distance.
  */
 Station * previousStation(int number) {
-    Station * best = NULL;
-    Station * current = root;
+    if (shardCount == 0)
+        return predecessorStation(root, number);
 
-    while (current != NULL) {
-        if (current -> distance < number) {
-            best = current;
-            current = current -> right;
-        } else {
-            current = current -> left;
-        }
+    for (int i = shardOf(number); i >= 0; i--) {
+        Station * best = predecessorStation(shards[i].root, number);
+        if (best != NULL)
+            return best;
     }
-    return best;
+    return NULL;
 }
 
 /**
@@ -487,7 +828,7 @@ Station * previousStation(int number) {
  * @return       An array of stations with infinity jumps.
  */
 Station ** createPathArray(int start, int end) {
-    Station * first = searchStation(root, start);
+    Station * first = findStation(start);
     Station * station = first;
     int counter = 1;
     while (station -> distance != end) {
@@ -518,7 +859,7 @@ Station ** createPathArray(int start, int end) {
  * @return       An array of stations with infinity jumps.
  */
 Station ** createPathArray2(int start, int end) { //I set the jumps to infinity
-    Station * first = searchStation(root, start);
+    Station * first = findStation(start);
     Station * station = first;
     int counter = 1;
     while (station -> distance != end) {
@@ -550,7 +891,7 @@ void directPlanRoute(int start, int end) {
 
     //case start and end stations coincide
     if (start == end) {
-        if (searchStation(root, start) == NULL) {
+        if (findStation(start) == NULL) {
             printf("nessun percorso\n");
             return;
         } else {
@@ -721,24 +1062,1158 @@ void planRoute() {
     }
 }
 
+/**
+ * Reads a varint gap from the distances of a block.
+ *
+ * @param gaps    The encoded gaps.
+ * @param offset  The offset of the gap, moved past it.
+ * @return        The decoded gap.
+ */
+int readGap(unsigned char * gaps, int * offset) {
+    unsigned int gap = 0;
+    int shift = 0;
+    while (gaps[ * offset] & 128) {
+        gap |= (unsigned int)(gaps[ * offset] & 127) << shift;
+        shift += 7;
+        ( * offset)++;
+    }
+    gap |= (unsigned int) gaps[ * offset] << shift;
+    ( * offset)++;
+    return (int) gap;
+}
+
+/**
+ * Decodes the distances of a block.
+ *
+ * @param block     The block to decode.
+ * @param distance  Array of at least block -> count elements filled with the distances.
+ */
+void decodeBlock(Block * block, int * distance) {
+    int offset = 0;
+    distance[0] = block -> first;
+    for (int i = 1; i < block -> count; i++) {
+        distance[i] = distance[i - 1] + readGap(block -> gaps, & offset);
+    }
+}
+
+/**
+ * Rewrites the stations of a block from sorted distances and ranges.
+ *
+ * @param block     The block to rewrite.
+ * @param distance  The sorted distances of its stations.
+ * @param range     The largest range of each station.
+ * @param count     The number of stations, at least 1.
+ */
+void encodeBlock(Block * block, int * distance, int * range, int count) {
+    unsigned char gaps[5 * BLOCK_SIZE];
+    int bytes = 0;
+    for (int i = 1; i < count; i++) {
+        unsigned int gap = (unsigned int)(distance[i] - distance[i - 1]);
+        while (gap >= 128) {
+            gaps[bytes++] = (unsigned char)(gap | 128);
+            gap >>= 7;
+        }
+        gaps[bytes++] = (unsigned char) gap;
+    }
+
+    block -> first = distance[0];
+    block -> count = count;
+    block -> bytes = bytes;
+    block -> range = (int * ) realloc(block -> range, sizeof(int) * count);
+    memcpy(block -> range, range, sizeof(int) * count);
+    block -> gaps = (unsigned char * ) realloc(block -> gaps, bytes + 1);
+    memcpy(block -> gaps, gaps, bytes);
+}
+
+/**
+ * Replaces the fleets of a block.
+ *
+ * @param block   The block to update.
+ * @param fleets  The fleets of its stations, in order of distance.
+ * @param size    The number of integers in fleets.
+ */
+void setBlockFleets(Block * block, int * fleets, int size) {
+    block -> fleets = (int * ) realloc(block -> fleets, sizeof(int) * (size + 1));
+    memcpy(block -> fleets, fleets, sizeof(int) * size);
+    block -> fleetSize = size;
+}
+
+/**
+ * Searches for the fleet of a station inside its block.
+ *
+ * @param fleets  The fleets of the block.
+ * @param index   The position of the station in the block.
+ * @return        Offset of the number of cars of the station.
+ */
+int fleetOffset(int * fleets, int index) {
+    int offset = 0;
+    for (int i = 0; i < index; i++) {
+        offset += fleets[offset] + 1;
+    }
+    return offset;
+}
+
+/**
+ * Inserts a range in an array sorted from the largest.
+ *
+ * @param ranges  The sorted ranges, with room for one more.
+ * @param count   The number of ranges in the array.
+ * @param number  The range to insert.
+ */
+void insertRange(int * ranges, int count, int number) {
+    while (count > 0 && ranges[count - 1] < number) {
+        ranges[count] = ranges[count - 1];
+        count--;
+    }
+    ranges[count] = number;
+}
+
+/**
+ * Searches for the block that may contain a distance.
+ *
+ * @param number  The distance to search for.
+ * @return        Index of the last block starting at or before the distance, 0 if it comes
+ *                before every block, -1 if there are no blocks.
+ */
+int searchBlock(int number) {
+    if (blockCount == 0)
+        return -1;
+
+    int low = 0;
+    int high = blockCount - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (blocks[middle].first <= number)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+/**
+ * Moves a cursor to the station with a specific distance, decoding its block on the fly.
+ *
+ * @param cursor  The cursor to move.
+ * @param number  The distance of the station to search for.
+ * @return        1 if the station exists, 0 otherwise.
+ */
+int seekBlockStation(BlockCursor * cursor, int number) {
+    cursor -> block = searchBlock(number);
+    if (cursor -> block == -1)
+        return 0;
+
+    Block * block = & blocks[cursor -> block];
+    cursor -> index = 0;
+    cursor -> offset = 0;
+    cursor -> distance = block -> first;
+    while (cursor -> distance < number && cursor -> index < block -> count - 1) {
+        cursor -> distance += readGap(block -> gaps, & cursor -> offset);
+        cursor -> index++;
+    }
+    return cursor -> distance == number;
+}
+
+/**
+ * Moves a cursor to the next station, if any.
+ *
+ * @param cursor  The cursor to move.
+ * @return        1 if there is a next station, 0 otherwise.
+ */
+int nextBlockStation(BlockCursor * cursor) {
+    if (cursor -> index < blocks[cursor -> block].count - 1) {
+        cursor -> distance += readGap(blocks[cursor -> block].gaps, & cursor -> offset);
+        cursor -> index++;
+        return 1;
+    }
+    if (cursor -> block == blockCount - 1)
+        return 0;
+
+    cursor -> block++;
+    cursor -> index = 0;
+    cursor -> offset = 0;
+    cursor -> distance = blocks[cursor -> block].first;
+    return 1;
+}
+
+/**
+ * Opens a gap in the array of blocks.
+ *
+ * @param index  The position of the new block.
+ */
+void insertBlock(int index) {
+    if (blockCount == blockCapacity) {
+        blockCapacity = blockCapacity == 0 ? 16 : blockCapacity * 2;
+        blocks = (Block * ) realloc(blocks, sizeof(Block) * blockCapacity);
+    }
+    memmove(blocks + index + 1, blocks + index, sizeof(Block) * (blockCount - index));
+    memset(blocks + index, 0, sizeof(Block));
+    blockCount++;
+}
+
+/**
+ * Frees a block and removes it from the array of blocks.
+ *
+ * @param index  The position of the block.
+ */
+void removeBlock(int index) {
+    free(blocks[index].range);
+    free(blocks[index].gaps);
+    free(blocks[index].fleets);
+    memmove(blocks + index, blocks + index + 1, sizeof(Block) * (blockCount - index - 1));
+    blockCount--;
+}
+
+/**
+ * Adds a station to the block storage, splitting its block when it is full.
+ *
+ * @param number  The distance of the new station, not present yet.
+ * @param cars    The ranges of its cars, sorted from the largest.
+ * @param count   The number of cars.
+ */
+void insertBlockStation(int number, int * cars, int count) {
+    int distance[BLOCK_SIZE + 1];
+    int ranges[BLOCK_SIZE + 1];
+    int range = count == 0 ? 0 : cars[0];
+
+    if (blockCount == 0) {
+        insertBlock(0);
+        encodeBlock(& blocks[0], & number, & range, 1);
+        blocks[0].fleets = (int * ) malloc(sizeof(int) * (count + 1));
+        blocks[0].fleets[0] = count;
+        memcpy(blocks[0].fleets + 1, cars, sizeof(int) * count);
+        blocks[0].fleetSize = count + 1;
+        return;
+    }
+
+    int index = searchBlock(number);
+    Block * block = & blocks[index];
+    decodeBlock(block, distance);
+    int position = block -> count;
+    while (position > 0 && distance[position - 1] > number) {
+        distance[position] = distance[position - 1];
+        ranges[position] = block -> range[position - 1];
+        position--;
+    }
+    memcpy(ranges, block -> range, sizeof(int) * position);
+    distance[position] = number;
+    ranges[position] = range;
+    int stations = block -> count + 1;
+
+    //the new fleet goes between the ones of its neighbours
+    int size = block -> fleetSize + count + 1;
+    int * fleets = (int * ) malloc(sizeof(int) * size);
+    int offset = fleetOffset(block -> fleets, position);
+    memcpy(fleets, block -> fleets, sizeof(int) * offset);
+    fleets[offset] = count;
+    memcpy(fleets + offset + 1, cars, sizeof(int) * count);
+    memcpy(fleets + offset + count + 1, block -> fleets + offset, sizeof(int) * (block -> fleetSize - offset));
+
+    if (stations <= BLOCK_SIZE) {
+        encodeBlock(block, distance, ranges, stations);
+        free(block -> fleets);
+        block -> fleets = fleets;
+        block -> fleetSize = size;
+        return;
+    }
+
+    //full block: the upper half moves to a new block
+    int half = stations / 2;
+    offset = fleetOffset(fleets, half);
+    insertBlock(index + 1);
+    encodeBlock(& blocks[index], distance, ranges, half);
+    setBlockFleets(& blocks[index], fleets, offset);
+    encodeBlock(& blocks[index + 1], distance + half, ranges + half, stations - half);
+    setBlockFleets(& blocks[index + 1], fleets + offset, size - offset);
+    free(fleets);
+}
+
+/**
+ * Merges two adjacent blocks if they fit in half a block.
+ *
+ * @param index  The position of the first block.
+ */
+void mergeBlocks(int index) {
+    if (index < 0 || index + 1 >= blockCount || blocks[index].count + blocks[index + 1].count > BLOCK_SIZE / 2)
+        return;
+
+    int distance[BLOCK_SIZE];
+    int ranges[BLOCK_SIZE];
+    Block * block = & blocks[index];
+    Block * next = & blocks[index + 1];
+    decodeBlock(block, distance);
+    decodeBlock(next, distance + block -> count);
+    memcpy(ranges, block -> range, sizeof(int) * block -> count);
+    memcpy(ranges + block -> count, next -> range, sizeof(int) * next -> count);
+
+    block -> fleets = (int * ) realloc(block -> fleets, sizeof(int) * (block -> fleetSize + next -> fleetSize));
+    memcpy(block -> fleets + block -> fleetSize, next -> fleets, sizeof(int) * next -> fleetSize);
+    block -> fleetSize += next -> fleetSize;
+    encodeBlock(block, distance, ranges, block -> count + next -> count);
+    removeBlock(index + 1);
+}
+
+/**
+ * Removes the station under a cursor, and its fleet, from the block storage.
+ *
+ * @param cursor  A cursor on the station to remove.
+ */
+void removeBlockStation(BlockCursor * cursor) {
+    int distance[BLOCK_SIZE];
+    int ranges[BLOCK_SIZE];
+    int index = cursor -> block;
+    Block * block = & blocks[index];
+
+    if (block -> count == 1) {
+        removeBlock(index);
+        return;
+    }
+
+    int offset = fleetOffset(block -> fleets, cursor -> index);
+    int length = block -> fleets[offset] + 1;
+    block -> fleetSize -= length;
+    memmove(block -> fleets + offset, block -> fleets + offset + length, sizeof(int) * (block -> fleetSize - offset));
+
+    decodeBlock(block, distance);
+    memcpy(ranges, block -> range, sizeof(int) * block -> count);
+    int count = block -> count - 1;
+    memmove(distance + cursor -> index, distance + cursor -> index + 1, sizeof(int) * (count - cursor -> index));
+    memmove(ranges + cursor -> index, ranges + cursor -> index + 1, sizeof(int) * (count - cursor -> index));
+    encodeBlock(block, distance, ranges, count);
+
+    mergeBlocks(index);
+    mergeBlocks(index - 1);
+}
+
+/**
+ * Adds a new station to the block storage based on user input.
+ *
+ * @return "aggiunta" if the station was successfully added, "non aggiunta" otherwise.
+ */
+char * addBlockStation() {
+    int num;
+    int num2;
+    BlockCursor cursor;
+    fscanf(file, "%d", & num);
+
+    //I empty the line if the station already exists
+    if (seekBlockStation(& cursor, num)) {
+        char str[3000];
+        fgets(str, 3000, file);
+        return "non aggiunta";
+    }
+
+    int station = num;
+    fscanf(file, "%d", & num);
+    int cars[num + 1];
+
+    //scroll through the cars to include in the station
+    for (int i = 0; i < num; i++) {
+        fscanf(file, "%d", & num2);
+        insertRange(cars, i, num2);
+    }
+
+    insertBlockStation(station, cars, num);
+    lastMutation = STATION_ADDED;
+    mutatedDistance = station;
+    mutatedRange = num == 0 ? 0 : cars[0];
+    return "aggiunta";
+}
+
+/**
+ * Removes a station from the block storage based on user input.
+ *
+ * @return "demolita" if the station was successfully removed, "non demolita" otherwise.
+ */
+char * deleteBlockStation() {
+    int num;
+    BlockCursor cursor;
+    fscanf(file, "%d", & num);
+
+    if (seekBlockStation(& cursor, num) == 0)
+        return "non demolita";
+
+    removeBlockStation(& cursor);
+    lastMutation = STATION_DELETED;
+    mutatedDistance = num;
+    return "demolita";
+}
+
+/**
+ * Adds a car to a station of the block storage based on user input.
+ *
+ * @return "aggiunta" if the car was successfully added, "non aggiunta" otherwise.
+ */
+char * addBlockCar() {
+    int num;
+    BlockCursor cursor;
+    fscanf(file, "%d", & num);
+
+    //case the station does not exist
+    if (seekBlockStation(& cursor, num) == 0) {
+        fscanf(file, "%d", & num);
+        return "non aggiunta";
+    }
+
+    fscanf(file, "%d", & num);
+    Block * block = & blocks[cursor.block];
+    int offset = fleetOffset(block -> fleets, cursor.index);
+    int count = block -> fleets[offset];
+    block -> fleets = (int * ) realloc(block -> fleets, sizeof(int) * (block -> fleetSize + 2));
+    memmove(block -> fleets + offset + count + 2, block -> fleets + offset + count + 1,
+        sizeof(int) * (block -> fleetSize - offset - count - 1));
+    insertRange(block -> fleets + offset + 1, count, num);
+    block -> fleets[offset]++;
+    block -> fleetSize++;
+    block -> range[cursor.index] = block -> fleets[offset + 1];
+
+    lastMutation = RANGE_CHANGED;
+    mutatedDistance = cursor.distance;
+    mutatedRange = block -> range[cursor.index];
+    return "aggiunta";
+}
+
+/**
+ * Removes a car from a station of the block storage based on user input.
+ *
+ * @return "rottamata" if the car was successfully removed, "non rottamata" otherwise.
+ */
+char * deleteBlockCar() {
+    int num;
+    BlockCursor cursor;
+    fscanf(file, "%d", & num);
+    int found = seekBlockStation(& cursor, num);
+    fscanf(file, "%d", & num);
+    if (found == 0)
+        return "non rottamata";
+
+    Block * block = & blocks[cursor.block];
+    int offset = fleetOffset(block -> fleets, cursor.index);
+    int count = block -> fleets[offset];
+    int i = 0;
+    while (i < count && block -> fleets[offset + 1 + i] != num) {
+        i++;
+    }
+    if (i == count)
+        return "non rottamata";
+
+    block -> fleetSize--;
+    memmove(block -> fleets + offset + 1 + i, block -> fleets + offset + 2 + i,
+        sizeof(int) * (block -> fleetSize - offset - 1 - i));
+    block -> fleets[offset]--;
+    block -> range[cursor.index] = count == 1 ? 0 : block -> fleets[offset + 1];
+
+    lastMutation = RANGE_CHANGED;
+    mutatedDistance = cursor.distance;
+    mutatedRange = block -> range[cursor.index];
+    return "rottamata";
+}
+
+/**
+ * Tells whether a distance comes before another one along a subscribed route.
+ *
+ * @param s  The subscription.
+ * @param a  The first distance.
+ * @param b  The second distance.
+ * @return   1 if a is met before b travelling from start to end, 0 otherwise.
+ */
+int precedes(Subscription * s, int a, int b) {
+    if (s -> start <= s -> end)
+        return a < b;
+    return a > b;
+}
+
+/**
+ * Searches for the position of a distance in the corridor of a subscription.
+ *
+ * @param s       The subscription.
+ * @param number  The distance to search for.
+ * @return        Index of the first station not preceding the distance.
+ */
+int corridorPosition(Subscription * s, int number) {
+    int low = 0;
+    int high = s -> size;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (precedes(s, s -> distance[middle], number))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Checks if a station of the corridor can reach a following one with a single car.
+ *
+ * @param s  The subscription.
+ * @param i  The index of the departure station.
+ * @param k  The index of the arrival station, greater than i.
+ * @return   1 if the arrival is within range, 0 otherwise.
+ */
+int reaches(Subscription * s, int i, int k) {
+    int gap = s -> distance[k] - s -> distance[i];
+    if (gap < 0)
+        gap = -gap;
+    return gap <= s -> range[i];
+}
+
+/**
+ * Makes room for one more station in the corridor of a subscription.
+ *
+ * @param s  The subscription to grow.
+ */
+void growSubscription(Subscription * s) {
+    if (s -> size < s -> capacity)
+        return;
+
+    s -> capacity = s -> capacity == 0 ? 16 : s -> capacity * 2;
+    s -> distance = (int * ) realloc(s -> distance, sizeof(int) * s -> capacity);
+    s -> range = (int * ) realloc(s -> range, sizeof(int) * s -> capacity);
+    s -> jumps = (int * ) realloc(s -> jumps, sizeof(int) * s -> capacity);
+    s -> parent = (int * ) realloc(s -> parent, sizeof(int) * s -> capacity);
+}
+
+/**
+ * Returns a station of the layer preceding the one of a given station.
+ *
+ * @param s         The subscription.
+ * @param position  The index of a reachable station.
+ * @return          The index of the last station one hop closer to the start, or 0.
+ */
+int layerBefore(Subscription * s, int position) {
+    int layer = s -> jumps[position];
+    while (position > 0 && s -> jumps[position] >= layer) {
+        position--;
+    }
+    return position;
+}
+
+/**
+ * Recomputes the hop labels of a corridor, one layer at a time, starting from the layer
+ * of a reachable station whose labels are known to be correct. Each station is reached
+ * from the station of the previous layer closest to the beginning of the highway, like
+ * directPlanRoute and inversePlanRoute do. Stops as soon as a layer past the dirty
+ * stations comes out unchanged, since the following layers only depend on it.
+ *
+ * @param s         The subscription to relabel.
+ * @param position  The index of a station of the first correct layer.
+ * @param dirty     The last index whose old labels cannot be trusted, or -1.
+ * @return          The first layer where a label changed, INT32_MAX if none did. Labelling
+ *                  a new station (marked by -1) is not a change by itself.
+ */
+int relabelSubscription(Subscription * s, int position, int dirty) {
+    int firstChange = INT32_MAX;
+    int layer = s -> jumps[position];
+    int first = position;
+    int last = position + 1;
+    while (first > 0 && s -> jumps[first - 1] == layer) {
+        first--;
+    }
+    while (last < s -> size && s -> jumps[last] == layer) {
+        last++;
+    }
+
+    while (last < s -> size) {
+        int touched = 0;
+        int k = last;
+
+        for (int n = 0; n < last - first; n++) {
+            //visit the layer from the station closest to the beginning of the highway
+            int i = s -> start <= s -> end ? first + n : last - 1 - n;
+            while (k < s -> size && reaches(s, i, k)) {
+                if (s -> jumps[k] != layer + 1 || s -> parent[k] != k - i) {
+                    if (s -> jumps[k] != -1 && firstChange == INT32_MAX)
+                        firstChange = layer + 1;
+                    s -> jumps[k] = layer + 1;
+                    s -> parent[k] = k - i;
+                    touched = 1;
+                }
+                k++;
+            }
+        }
+
+        //the layer does not move forward, the rest of the corridor is unreachable
+        if (k == last) {
+            while (k < s -> size && s -> jumps[k] != INT32_MAX) {
+                if (s -> jumps[k] != -1 && firstChange == INT32_MAX)
+                    firstChange = layer + 1;
+                s -> jumps[k] = INT32_MAX;
+                s -> parent[k] = 0;
+                k++;
+            }
+            return firstChange;
+        }
+
+        //same layer as before: the following ones cannot change
+        if (touched == 0 && k > dirty && (k == s -> size || s -> jumps[k] != layer + 1))
+            return firstChange;
+
+        first = last;
+        last = k;
+        layer++;
+    }
+    return firstChange;
+}
+
+/**
+ * Appends a station to the corridor of a subscription, still unlabelled.
+ *
+ * @param s         The subscription.
+ * @param distance  The distance of the station.
+ * @param range     Its largest range.
+ */
+void appendCorridor(Subscription * s, int distance, int range) {
+    growSubscription(s);
+    s -> distance[s -> size] = distance;
+    s -> range[s -> size] = range;
+    s -> jumps[s -> size] = -1;
+    s -> parent[s -> size] = 0;
+    s -> size++;
+}
+
+/**
+ * Collects the stations between the two ends of a subscription and labels them from scratch.
+ *
+ * @param s  The subscription to build.
+ */
+void buildSubscription(Subscription * s) {
+    int low = s -> start < s -> end ? s -> start : s -> end;
+    int high = s -> start < s -> end ? s -> end : s -> start;
+    s -> size = 0;
+    s -> active = 0;
+
+    if (blockStorage) {
+        BlockCursor cursor;
+        if (seekBlockStation(& cursor, high) == 0 || seekBlockStation(& cursor, low) == 0)
+            return;
+
+        appendCorridor(s, cursor.distance, blocks[cursor.block].range[cursor.index]);
+        while (cursor.distance != high) {
+            nextBlockStation(& cursor);
+            appendCorridor(s, cursor.distance, blocks[cursor.block].range[cursor.index]);
+        }
+    } else {
+        Station * station = findStation(low);
+        if (station == NULL || findStation(high) == NULL)
+            return;
+
+        appendCorridor(s, station -> distance, maxRange(station));
+        while (station -> distance != high) {
+            station = nextStation(station -> distance);
+            appendCorridor(s, station -> distance, maxRange(station));
+        }
+    }
+
+    //inverse routes are stored from the higher station to the lower one
+    if (s -> start > s -> end) {
+        for (int i = 0; i < s -> size / 2; i++) {
+            int j = s -> size - 1 - i;
+            int supp = s -> distance[i];
+            s -> distance[i] = s -> distance[j];
+            s -> distance[j] = supp;
+            supp = s -> range[i];
+            s -> range[i] = s -> range[j];
+            s -> range[j] = supp;
+        }
+    }
+
+    s -> active = 1;
+    s -> jumps[0] = 0;
+    relabelSubscription(s, 0, s -> size - 1);
+}
+
+/**
+ * Repairs the labelling of a subscription after the last mutation.
+ *
+ * @param s  The subscription to repair.
+ * @return   The first layer whose labels changed, 0 if the subscription was rebuilt or
+ *           invalidated, INT32_MAX if its route cannot have changed.
+ */
+int repairSubscription(Subscription * s) {
+    int low = s -> start < s -> end ? s -> start : s -> end;
+    int high = s -> start < s -> end ? s -> end : s -> start;
+    if (mutatedDistance < low || mutatedDistance > high)
+        return INT32_MAX;
+
+    //only the return of a missing end can revive a subscription
+    if (s -> active == 0) {
+        if (lastMutation != STATION_ADDED || (mutatedDistance != s -> start && mutatedDistance != s -> end))
+            return INT32_MAX;
+        buildSubscription(s);
+        return 0;
+    }
+
+    int p = corridorPosition(s, mutatedDistance);
+
+    if (lastMutation == RANGE_CHANGED) {
+        if (s -> range[p] == mutatedRange)
+            return INT32_MAX;
+        s -> range[p] = mutatedRange;
+        if (s -> jumps[p] == INT32_MAX)
+            return INT32_MAX;
+        return relabelSubscription(s, p, -1);
+    }
+
+    if (lastMutation == STATION_ADDED) {
+        growSubscription(s);
+        int moved = s -> size - p;
+        memmove(s -> distance + p + 1, s -> distance + p, sizeof(int) * moved);
+        memmove(s -> range + p + 1, s -> range + p, sizeof(int) * moved);
+        memmove(s -> jumps + p + 1, s -> jumps + p, sizeof(int) * moved);
+        memmove(s -> parent + p + 1, s -> parent + p, sizeof(int) * moved);
+        s -> size++;
+        s -> distance[p] = mutatedDistance;
+        s -> range[p] = mutatedRange;
+        s -> parent[p] = 0;
+        if (s -> jumps[p - 1] == INT32_MAX) {
+            s -> jumps[p] = INT32_MAX;
+            return INT32_MAX;
+        }
+        //only the layer following the one before the new station can jump over it
+        for (int k = p + 1; k < s -> size && s -> jumps[k] <= s -> jumps[p - 1] + 1; k++) {
+            if (k - 1 - s -> parent[k] < p)
+                s -> parent[k]++;
+        }
+        s -> jumps[p] = -1;
+        return relabelSubscription(s, layerBefore(s, p - 1), p);
+    }
+
+    //demolishing one of the two ends invalidates the subscription
+    if (p == 0 || p == s -> size - 1) {
+        s -> active = 0;
+        return 0;
+    }
+
+    //the labels up to the last station the demolished one reached may depend on it
+    int dirty = p;
+    while (dirty + 1 < s -> size && reaches(s, p, dirty + 1)) {
+        dirty++;
+    }
+    //and only the layer following the demolished one can have stops jumping over it
+    int limit = s -> jumps[p] == INT32_MAX ? -1 : s -> jumps[p] + 1;
+
+    int moved = s -> size - p - 1;
+    memmove(s -> distance + p, s -> distance + p + 1, sizeof(int) * moved);
+    memmove(s -> range + p, s -> range + p + 1, sizeof(int) * moved);
+    memmove(s -> jumps + p, s -> jumps + p + 1, sizeof(int) * moved);
+    memmove(s -> parent + p, s -> parent + p + 1, sizeof(int) * moved);
+    s -> size--;
+    for (int k = p; k < s -> size && s -> jumps[k] <= limit; k++) {
+        int previous = k + 1 - s -> parent[k];
+        //orphans always count as changed
+        if (previous == p)
+            s -> parent[k] = 0;
+        else if (previous < p)
+            s -> parent[k]--;
+    }
+    if (s -> jumps[p - 1] == INT32_MAX)
+        return INT32_MAX;
+    return relabelSubscription(s, layerBefore(s, p - 1), dirty - 1);
+}
+
+/**
+ * Brings the route of a subscription up to date with its labels, walking back from the
+ * end only until a stop before the first changed layer is found unchanged.
+ *
+ * @param s      The subscription.
+ * @param layer  The first layer whose labels changed.
+ * @return       1 if the route differs from the previous one, 0 otherwise.
+ */
+int updateSubscriptionRoute(Subscription * s, int layer) {
+    int length = 0;
+    if (s -> active && s -> jumps[s -> size - 1] != INT32_MAX)
+        length = s -> jumps[s -> size - 1] + 1;
+
+    int rewrite = length != s -> routeLength;
+    int changed = rewrite;
+    if (rewrite) {
+        s -> route = (int * ) realloc(s -> route, sizeof(int) * (length + 1));
+        s -> routeLength = length;
+    }
+
+    int position = s -> size - 1;
+    for (int i = length - 1; i != -1; i--) {
+        if (rewrite || s -> route[i] != s -> distance[position]) {
+            s -> route[i] = s -> distance[position];
+            changed = 1;
+        } else if (i < layer) {
+            break;
+        }
+        position -= s -> parent[position];
+    }
+    return changed;
+}
+
+/**
+ * Prints a sequence of stops, or "nessun percorso" if it is empty.
+ *
+ * @param stops   The distances of the stops in order of travel.
+ * @param length  The number of stops.
+ */
+void printStops(int * stops, int length) {
+    if (length == 0) {
+        printf("nessun percorso\n");
+        return;
+    }
+    for (int i = 0; i < length - 1; i++) {
+        printf("%d ", stops[i]);
+    }
+    printf("%d\n", stops[length - 1]);
+}
+
+/**
+ * Registers a standing route based on user input and prints its current stops.
+ */
+void subscribeRoute() {
+    int num;
+    int num2;
+    fscanf(file, "%d %d", & num, & num2);
+
+    Subscription * s = subscriptions;
+    Subscription * last = NULL;
+    while (s != NULL && (s -> start != num || s -> end != num2)) {
+        last = s;
+        s = s -> next;
+    }
+
+    if (s == NULL) {
+        s = (Subscription * ) calloc(1, sizeof(Subscription));
+        s -> start = num;
+        s -> end = num2;
+        if (last == NULL)
+            subscriptions = s;
+        else
+            last -> next = s;
+        buildSubscription(s);
+        updateSubscriptionRoute(s, 0);
+    }
+    printStops(s -> route, s -> routeLength);
+}
+
+/**
+ * Plans a route on the block storage based on user input, labelling the decoded corridor
+ * like a subscription that is discarded right after.
+ */
+void planBlockRoute() {
+    Subscription s;
+    memset(& s, 0, sizeof(Subscription));
+    fscanf(file, "%d %d", & s.start, & s.end);
+
+    buildSubscription(& s);
+    updateSubscriptionRoute(& s, 0);
+    printStops(s.route, s.routeLength);
+
+    free(s.distance);
+    free(s.range);
+    free(s.jumps);
+    free(s.parent);
+    free(s.route);
+}
+
+/**
+ * Repairs every subscription touched by the last mutation and prints the routes that changed.
+ */
+void updateSubscriptions() {
+    if (lastMutation == NO_MUTATION)
+        return;
+
+    for (Subscription * s = subscriptions; s != NULL; s = s -> next) {
+        int layer = repairSubscription(s);
+        if (layer != INT32_MAX && updateSubscriptionRoute(s, layer)) {
+            printf("percorso %d %d: ", s -> start, s -> end);
+            printStops(s -> route, s -> routeLength);
+        }
+    }
+    lastMutation = NO_MUTATION;
+}
+
+/**
+ * Reads a mutation command into the pending batch.
+ *
+ * @param kind  The kind of the command.
+ */
+void readCommand(CommandKind kind) {
+    Command * command = & batch[batchSize++];
+    command -> kind = kind;
+    command -> count = 1;
+    fscanf(file, "%d", & command -> distance);
+    if (kind == DELETE_STATION) {
+        command -> count = 0;
+    } else if (kind == ADD_STATION) {
+        fscanf(file, "%d", & command -> count);
+    }
+
+    command -> values = (int * ) malloc(sizeof(int) * (command -> count + 1));
+    for (int i = 0; i < command -> count; i++) {
+        fscanf(file, "%d", & command -> values[i]);
+    }
+}
+
+/**
+ * Checks if a distance is one of the ends of a subscription.
+ *
+ * @param number  The distance.
+ * @return        1 if some subscription starts or ends there, 0 otherwise.
+ */
+int isSubscribedEnd(int number) {
+    for (Subscription * s = subscriptions; s != NULL; s = s -> next) {
+        if (s -> start == number || s -> end == number)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Applies a mutation command to the shard owning its station.
+ *
+ * @param shard    The shard of the station.
+ * @param command  The command, which receives its response and mutation.
+ */
+void applyCommand(Shard * shard, Command * command) {
+    int number = command -> distance;
+    Station * station = searchLiveStation(shard -> root, number);
+    command -> mutation = NO_MUTATION;
+
+    if (command -> kind == ADD_STATION) {
+        if (station != NULL) {
+            command -> response = "non aggiunta";
+            return;
+        }
+        station = tombstones ? searchStation(shard -> root, number) : NULL;
+        if (station != NULL) {
+            reviveStation(station, & shard -> dead);
+        } else {
+            shard -> root = addStationRecursively(shard -> root, number);
+            station = searchStation(shard -> root, number);
+        }
+        if (tombstones)
+            shard -> live++;
+        for (int i = 0; i < command -> count; i++) {
+            addCar(station, command -> values[i]);
+        }
+        command -> response = "aggiunta";
+        command -> mutation = STATION_ADDED;
+    } else if (command -> kind == DELETE_STATION) {
+        if (station == NULL) {
+            command -> response = "non demolita";
+            return;
+        }
+        if (tombstones)
+            shard -> root = buryStation(shard -> root, number, & shard -> live, & shard -> dead);
+        else
+            shard -> root = deleteStation(shard -> root, number);
+        command -> response = "demolita";
+        command -> mutation = STATION_DELETED;
+        return;
+    } else if (command -> kind == ADD_CAR) {
+        if (station == NULL) {
+            command -> response = "non aggiunta";
+            return;
+        }
+        addCar(station, command -> values[0]);
+        command -> response = "aggiunta";
+        command -> mutation = RANGE_CHANGED;
+    } else {
+        boolean = 0;
+        if (station != NULL)
+            deleteCar(station, command -> values[0]);
+        if (boolean == 0) {
+            command -> response = "non rottamata";
+            return;
+        }
+        command -> response = "rottamata";
+        command -> mutation = RANGE_CHANGED;
+    }
+    command -> range = maxRange(station);
+}
+
+/**
+ * Applies the commands of the pending batch that belong to the shards of a worker.
+ * Every shard is owned by a single worker, so its commands keep their order.
+ *
+ * @param worker  The index of the worker.
+ */
+void applyBatch(int worker) {
+    for (int i = workerStart[worker]; i < workerEnd[worker]; i++) {
+        Command * command = & batch[batchOrder[i]];
+        applyCommand(& shards[shardOf(command -> distance)], command);
+    }
+}
+
+/**
+ * Loop of a pooled thread: waits for the next batch, applies its share and reports back.
+ *
+ * @param argument  The index of the worker.
+ * @return          Never returns.
+ */
+void * runWorker(void * argument) {
+    int worker = (int)(intptr_t) argument;
+    int round = 0;
+    pthread_mutex_lock(& poolLock);
+    while (1) {
+        while (poolRound == round) {
+            pthread_cond_wait(& poolWake, & poolLock);
+        }
+        round = poolRound;
+        pthread_mutex_unlock(& poolLock);
+        applyBatch(worker);
+        pthread_mutex_lock(& poolLock);
+        if (--poolPending == 0)
+            pthread_cond_signal(& poolDone);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the pooled threads, reused by every batch. If a thread cannot be created, its share
+ * and the following ones are applied by the main thread.
+ */
+void startWorkers() {
+    pthread_t thread;
+    while (startedThreads < threadCount) {
+        if (pthread_create(& thread, NULL, runWorker, (void * )(intptr_t) startedThreads) != 0)
+            return;
+        pthread_detach(thread);
+        startedThreads++;
+    }
+}
+
+/**
+ * Applies the pending batch, in parallel when it is large enough, then prints the responses
+ * and updates the subscriptions in the original order of the commands.
+ */
+void flushBatch() {
+    if (batchSize >= MIN_PARALLEL_BATCH && threadCount > 1) {
+        //group the commands by worker once, keeping their order inside each group
+        memset(workerStart, 0, sizeof(workerStart));
+        for (int i = 0; i < batchSize; i++) {
+            workerStart[shardOf(batch[i].distance) % threadCount + 1]++;
+        }
+        for (int w = 0; w < threadCount; w++) {
+            workerStart[w + 1] += workerStart[w];
+            workerEnd[w] = workerStart[w];
+        }
+        for (int i = 0; i < batchSize; i++) {
+            batchOrder[workerEnd[shardOf(batch[i].distance) % threadCount]++] = i;
+        }
+
+        pthread_mutex_lock(& poolLock);
+        poolPending = startedThreads - 1;
+        poolRound++;
+        pthread_cond_broadcast(& poolWake);
+        pthread_mutex_unlock(& poolLock);
+        applyBatch(0);
+        for (int w = startedThreads; w < threadCount; w++) {
+            applyBatch(w);
+        }
+        pthread_mutex_lock(& poolLock);
+        while (poolPending > 0) {
+            pthread_cond_wait(& poolDone, & poolLock);
+        }
+        pthread_mutex_unlock(& poolLock);
+    } else {
+        for (int i = 0; i < batchSize; i++) {
+            applyCommand(& shards[shardOf(batch[i].distance)], & batch[i]);
+        }
+    }
+
+    for (int i = 0; i < batchSize; i++) {
+        printf("%s\n", batch[i].response);
+        lastMutation = batch[i].mutation;
+        mutatedDistance = batch[i].distance;
+        mutatedRange = batch[i].range;
+        updateSubscriptions();
+        free(batch[i].values);
+    }
+    batchSize = 0;
+}
+
 int main(int argc, char * argv[]) {
     file = stdin;
     char str[30];
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--blocks"))
+            blockStorage = 1;
+        else if (!strcmp(argv[i], "--tombstones"))
+            tombstones = 1;
+        else if (!strcmp(argv[i], "--shards") && i + 1 < argc)
+            shardCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--shard-km") && i + 1 < argc)
+            shardWidth = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            threadCount = atoi(argv[++i]);
+    }
+
+    //shards and tombstones work on the tree, they do not apply to the block storage
+    if (blockStorage)
+        tombstones = 0;
+    if (blockStorage || shardCount < 1 || shardWidth < 1)
+        shardCount = 0;
+    if (shardCount != 0) {
+        shards = (Shard * ) calloc(shardCount, sizeof(Shard));
+        batch = (Command * ) malloc(sizeof(Command) * MAX_BATCH);
+        batchOrder = (int * ) malloc(sizeof(int) * MAX_BATCH);
+        //one thread per online processor by default, never more than there are shards
+        if (threadCount < 1)
+            threadCount = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        if (threadCount > shardCount)
+            threadCount = shardCount;
+        if (threadCount > MAX_THREADS)
+            threadCount = MAX_THREADS;
+        if (threadCount < 1)
+            threadCount = 1;
+        startWorkers();
+    }
+
     fscanf(file, "%s", str);
 
     do {
-        if (!strcmp(str, "aggiungi-stazione")) {
-            printf("%s\n", addStation());
+        if (shardCount != 0) {
+            //independent mutations are batched, anything else sees all of them applied
+            if (!strcmp(str, "aggiungi-stazione")) {
+                readCommand(ADD_STATION);
+                //a subscription revived by this station reads the shards, which must not hold later commands
+                if (isSubscribedEnd(batch[batchSize - 1].distance))
+                    flushBatch();
+            } else if (!strcmp(str, "demolisci-stazione")) {
+                readCommand(DELETE_STATION);
+            } else if (!strcmp(str, "aggiungi-auto")) {
+                readCommand(ADD_CAR);
+            } else if (!strcmp(str, "rottama-auto")) {
+                readCommand(DELETE_CAR);
+            } else {
+                flushBatch();
+                if (!strcmp(str, "pianifica-percorso"))
+                    planRoute();
+                else if (!strcmp(str, "sottoscrivi-percorso"))
+                    subscribeRoute();
+            }
+            if (batchSize == MAX_BATCH)
+                flushBatch();
+        } else if (!strcmp(str, "aggiungi-stazione")) {
+            printf("%s\n", blockStorage ? addBlockStation() : addStation());
         } else if (!strcmp(str, "demolisci-stazione")) {
-            printf("%s\n", deleteStationSupport());
+            printf("%s\n", blockStorage ? deleteBlockStation() : deleteStationSupport());
         } else if (!strcmp(str, "aggiungi-auto")) {
-            printf("%s\n", addCarSupport());
+            printf("%s\n", blockStorage ? addBlockCar() : addCarSupport());
         } else if (!strcmp(str, "rottama-auto")) {
-            printf("%s\n", deleteCarSupport());
+            printf("%s\n", blockStorage ? deleteBlockCar() : deleteCarSupport());
         } else if (!strcmp(str, "pianifica-percorso")) {
-            planRoute();
+            if (blockStorage)
+                planBlockRoute();
+            else
+                planRoute();
+        } else if (!strcmp(str, "sottoscrivi-percorso")) {
+            subscribeRoute();
         }
+        updateSubscriptions();
         fscanf(file, "%s", str);
 
     } while (feof(file) == 0);
+
+    if (shardCount != 0)
+        flushBatch();
 }
\ No newline at end of file